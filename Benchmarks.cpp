@@ -0,0 +1,610 @@
+#include "stdafx.h"
+#include "Benchmarks.h"
+#include "TestData.h"
+#include "ResManagement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+using BenchClock = std::chrono::steady_clock;
+
+const char* levelName(CpuLevel level)
+{
+    switch (level)
+    {
+    case CpuLevel::Scalar:
+        return "scalar";
+    case CpuLevel::Sse42:
+        return "sse4.2";
+    case CpuLevel::Avx2:
+        return "avx2";
+    }
+    return "?";
+}
+
+double gigabytesPerSecond(size_t bytes, BenchClock::duration elapsed)
+{
+    return bytes / std::chrono::duration<double>(elapsed).count() / 1e9;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Scheduler trace
+//---------------------------------------------------------------------------------------------------------------------
+using SimClock = LoadScheduler::Clock;
+
+struct TraceEvent
+{
+    enum class Kind
+    {
+        Request,
+        Reprioritize,
+        Cancel
+    };
+
+    Kind kind = Kind::Request;
+    SimClock::duration at {}; // from trace start
+    uint32_t resource = 0;
+    int priority = 0;
+    std::optional<SimClock::duration> deadline; // from event
+    SimClock::duration read {}; // how long io part takes, for first request of resource
+};
+
+// Camera flying through streamed level: every frame one resource needed soon and many prefetched,
+// some prefetched become needed soon, from time to time camera turns and old prefetches are dropped
+std::vector<TraceEvent> makeStreamingTrace()
+{
+    using namespace std::chrono;
+    constexpr auto FRAMES = 300;
+    constexpr auto PREFETCH_PER_FRAME = 14;
+    const auto frame = milliseconds(16);
+    const auto urgentDeadline = milliseconds(50);
+
+    auto random = std::mt19937 {42};
+    auto readTime = [&random] { return microseconds(3000 + random() % 4000); };
+    auto trace = std::vector<TraceEvent> {};
+    auto nextResource = uint32_t {0};
+    auto prefetched = std::vector<uint32_t> {};
+    for (auto f = 0; f < FRAMES; ++f)
+    {
+        const auto at = SimClock::duration {frame * f};
+        auto urgent = TraceEvent {};
+        urgent.at = at;
+        urgent.resource = nextResource++;
+        urgent.priority = 10;
+        urgent.deadline = urgentDeadline;
+        urgent.read = readTime();
+        trace.push_back(urgent);
+        for (auto i = 0; i < PREFETCH_PER_FRAME; ++i)
+        {
+            auto prefetch = TraceEvent {};
+            prefetch.at = at;
+            prefetch.resource = nextResource++;
+            prefetch.read = readTime();
+            trace.push_back(prefetch);
+            prefetched.push_back(prefetch.resource);
+        }
+        if (f % 4 == 3)
+        {
+            // resource prefetched few frames ago is needed now, request joins the load
+            auto joined = urgent;
+            joined.resource = prefetched[prefetched.size() - 3 * PREFETCH_PER_FRAME / 2];
+            trace.push_back(joined);
+        }
+        if (f % 30 == 29)
+        {
+            for (auto i = size_t {1}; i <= 3; ++i)
+            {
+                auto closer = TraceEvent {};
+                closer.kind = TraceEvent::Kind::Reprioritize;
+                closer.at = at;
+                closer.resource = prefetched[prefetched.size() - i];
+                closer.priority = 5;
+                closer.deadline = milliseconds(100);
+                trace.push_back(closer);
+            }
+            for (auto i = size_t {0}; i < 5; ++i)
+            {
+                auto behind = TraceEvent {};
+                behind.kind = TraceEvent::Kind::Cancel;
+                behind.at = at;
+                behind.resource = prefetched[prefetched.size() - 20 * PREFETCH_PER_FRAME + i];
+                trace.push_back(behind);
+            }
+        }
+    }
+    return trace;
+}
+
+// Trace written by Factory::recordTrace, read time of each load goes to requests of it before
+bool loadTrace(const std::string& path, std::vector<TraceEvent>& trace)
+{
+    auto file = std::ifstream {path};
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: cannot open file!" << path;
+        return false;
+    }
+    auto resources = std::unordered_map<std::string, uint32_t> {};
+    auto unread = std::unordered_map<uint32_t, std::vector<size_t>> {};
+    auto line = std::string {};
+    auto number = 0;
+    while (std::getline(file, line))
+    {
+        ++number;
+        if (line.empty())
+            continue;
+        auto fields = std::istringstream {line};
+        auto at = int64_t {0};
+        auto kind = std::string {};
+        auto event = TraceEvent {};
+        fields >> at >> kind;
+        event.at = std::chrono::microseconds {at};
+        auto read = int64_t {0};
+        if (kind == "request" || kind == "reprioritize")
+        {
+            event.kind = kind == "request" ? TraceEvent::Kind::Request : TraceEvent::Kind::Reprioritize;
+            auto deadline = std::string {};
+            fields >> event.priority >> deadline;
+            if (fields && deadline != "-")
+            {
+                auto parsed = std::istringstream {deadline};
+                auto microseconds = int64_t {0};
+                parsed >> microseconds;
+                if (!parsed)
+                {
+                    fields.setstate(std::istringstream::failbit);
+                }
+                event.deadline = std::chrono::microseconds {microseconds};
+            }
+        }
+        else if (kind == "cancel")
+        {
+            event.kind = TraceEvent::Kind::Cancel;
+        }
+        else if (kind == "read")
+        {
+            fields >> read;
+        }
+        else
+        {
+            fields.setstate(std::istringstream::failbit);
+        }
+        auto resource = std::string {};
+        if (!fields || !std::getline(fields >> std::ws, resource) || resource.empty())
+        {
+            std::cout << "ERROR: cannot read trace! " << path << " line " << number << "\n";
+            return false;
+        }
+        event.resource = resources.emplace(resource, static_cast<uint32_t>(resources.size())).first->second;
+        if (kind == "read")
+        {
+            for (const auto index : unread[event.resource])
+            {
+                trace[index].read = std::chrono::microseconds {read};
+            }
+            unread.erase(event.resource);
+            continue;
+        }
+        if (event.kind == TraceEvent::Kind::Request)
+        {
+            unread[event.resource].push_back(trace.size());
+        }
+        trace.push_back(event);
+    }
+    // written under lock, so in order already unless edited by hand
+    std::stable_sort(begin(trace), end(trace), [](auto& a, auto& b) { return a.at < b.at; });
+    return true;
+}
+
+struct ReplayResult
+{
+    LoadScheduler::Stats stats;
+    uint64_t urgentRequests = 0;
+    double urgentMeanMs = 0.0;
+    double urgentMaxMs = 0.0;
+};
+
+// same io slot count as Factory, io part only, cpu part does not hold slot
+ReplayResult replay(const std::vector<TraceEvent>& trace, LoadScheduler::Ordering ordering)
+{
+    auto scheduler = LoadScheduler {LoadQueues::DEFAULT_IO_THREADS, ordering};
+    const auto start = SimClock::time_point {};
+    auto now = start;
+    auto running = std::multimap<SimClock::time_point, LoadScheduler::Id> {};
+    auto pending = std::unordered_map<uint32_t, LoadScheduler::Id> {};
+    auto resources = std::unordered_map<LoadScheduler::Id, uint32_t> {};
+    auto reads = std::unordered_map<LoadScheduler::Id, SimClock::duration> {};
+    // issue time of every request joined to load, in scheduler order, empty when request has no deadline
+    auto urgent = std::unordered_map<LoadScheduler::Id, std::vector<std::optional<SimClock::time_point>>> {};
+    auto result = ReplayResult {};
+    auto urgentTotalMs = 0.0;
+
+    const auto startAll = [&]
+    {
+        while (const auto id = scheduler.next())
+        {
+            running.emplace(now + reads[*id], *id);
+        }
+    };
+    auto event = begin(trace);
+    while (event != end(trace) || !running.empty())
+    {
+        const auto eventTime = event != end(trace) ? start + event->at : SimClock::time_point::max();
+        if (!running.empty() && running.begin()->first <= eventTime)
+        {
+            const auto [finished, id] = *running.begin();
+            running.erase(running.begin());
+            now = finished;
+            scheduler.complete(id, now);
+            for (auto issued : urgent[id])
+            {
+                if (!issued)
+                    continue;
+                const auto waited = std::chrono::duration<double, std::milli>(now - *issued).count();
+                urgentTotalMs += waited;
+                result.urgentMaxMs = std::max(result.urgentMaxMs, waited);
+                ++result.urgentRequests;
+            }
+            pending.erase(resources[id]);
+            startAll();
+            continue;
+        }
+
+        now = eventTime;
+        auto priority = LoadPriority {};
+        priority.priority = event->priority;
+        if (event->deadline)
+        {
+            priority.deadline = now + *event->deadline;
+        }
+        const auto inFlight = pending.find(event->resource);
+        switch (event->kind)
+        {
+        case TraceEvent::Kind::Request:
+            if (inFlight != end(pending))
+            {
+                scheduler.join(inFlight->second, priority);
+            }
+            else
+            {
+                const auto id = scheduler.enqueue(priority);
+                pending[event->resource] = id;
+                resources[id] = event->resource;
+                reads[id] = event->read;
+            }
+            urgent[pending[event->resource]].push_back(
+                priority.deadline ? std::optional<SimClock::time_point> {now} : std::nullopt);
+            break;
+        case TraceEvent::Kind::Reprioritize:
+            // like scheduler, only request which started load is changed
+            if (inFlight != end(pending) && scheduler.reprioritize(inFlight->second, priority))
+            {
+                urgent[inFlight->second].front() =
+                    priority.deadline ? std::optional<SimClock::time_point> {now} : std::nullopt;
+            }
+            break;
+        case TraceEvent::Kind::Cancel:
+            if (inFlight != end(pending) && scheduler.cancel(inFlight->second, now))
+            {
+                urgent.erase(inFlight->second);
+                pending.erase(inFlight);
+            }
+            break;
+        }
+        ++event;
+        startAll();
+    }
+    result.stats = scheduler.stats(now);
+    result.urgentMeanMs = result.urgentRequests ? urgentTotalMs / result.urgentRequests : 0.0;
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Async loads
+//---------------------------------------------------------------------------------------------------------------------
+template <typename Factory>
+void measureLoads(const char* name, const std::vector<std::string>& paths)
+{
+    const auto milliseconds = [](BenchClock::duration elapsed)
+    {
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    };
+
+    // nothing is held, so every load reads file again
+    const auto blockingStart = BenchClock::now();
+    auto failed = 0;
+    for (auto& path : paths)
+    {
+        failed += !Factory::load(path);
+    }
+    const auto blocking = milliseconds(BenchClock::now() - blockingStart);
+
+    auto access = std::mutex {};
+    auto finished = std::condition_variable {};
+    auto done = size_t {0};
+    auto latencies = std::vector<double>(paths.size());
+    const auto asyncStart = BenchClock::now();
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto requested = BenchClock::now();
+        Factory::loadAsync(paths[i], [&, i, requested](typename Factory::TypeSharedPtr data)
+        {
+            const auto latency = milliseconds(BenchClock::now() - requested);
+            std::scoped_lock<std::mutex> guard {access};
+            latencies[i] = latency;
+            failed += !data;
+            ++done;
+            finished.notify_one();
+        });
+    }
+    {
+        std::unique_lock<std::mutex> guard {access};
+        finished.wait(guard, [&] { return done == paths.size(); });
+    }
+    const auto async = milliseconds(BenchClock::now() - asyncStart);
+    auto mean = 0.0;
+    for (const auto latency : latencies)
+    {
+        mean += latency / latencies.size();
+    }
+
+    std::cout << name << ": blocking " << blocking << " ms (" << paths.size() / blocking * 1000 << " loads/s)"
+        << ", async " << async << " ms (" << paths.size() / async * 1000 << " loads/s)"
+        << ", latency mean " << mean << " ms, max " << *std::max_element(begin(latencies), end(latencies))
+        << " ms, " << failed << " failed\n";
+}
+}
+
+void benchmarkPayloadKernels()
+{
+    constexpr auto PAYLOADS = 100000;
+    constexpr auto ROUNDS = 20;
+    constexpr auto CHECK_SIZE = 123; // not multiple of any vector width, so tails are covered too
+    const auto& scalar = payloadKernel(CpuLevel::Scalar);
+
+    std::cout << "Detected: " << levelName(detectCpuLevel()) << "\n";
+    auto payloads = std::vector<std::array<unsigned char, 120>>(PAYLOADS);
+    auto random = std::mt19937 {1};
+    for (auto& payload : payloads)
+    {
+        for (auto& byte : payload)
+        {
+            byte = static_cast<unsigned char>(random());
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto level = 0; level <= static_cast<int>(detectCpuLevel()); ++level)
+    {
+        const auto kernel = payloadKernel(static_cast<CpuLevel>(level));
+
+        // standard check value of CRC32C
+        const auto text = reinterpret_cast<const unsigned char*>("123456789");
+        auto correct = kernel.crc32c(text, 9, 0) == 0xE3069283u;
+        correct = correct && kernel.crc32c(text + 4, 5, kernel.crc32c(text, 4, 0)) == 0xE3069283u;
+        unsigned char swapped[CHECK_SIZE];
+        unsigned char expected[CHECK_SIZE];
+        for (auto i = 0; i < CHECK_SIZE; ++i)
+        {
+            swapped[i] = expected[i] = static_cast<unsigned char>(i * 7);
+        }
+        kernel.byteSwap32(swapped, CHECK_SIZE);
+        scalar.byteSwap32(expected, CHECK_SIZE);
+        correct = correct && memcmp(swapped, expected, CHECK_SIZE) == 0;
+
+        auto digest = uint32_t {0};
+        const auto start = BenchClock::now();
+        for (auto round = 0; round < ROUNDS; ++round)
+        {
+            for (auto& payload : payloads)
+            {
+                digest = kernel.crc32c(payload.data(), payload.size(), digest);
+            }
+        }
+        const auto checksummed = BenchClock::now();
+        for (auto round = 0; round < ROUNDS; ++round)
+        {
+            for (auto& payload : payloads)
+            {
+                kernel.byteSwap32(payload.data(), payload.size());
+            }
+        }
+        const auto swappedAll = BenchClock::now();
+
+        const auto bytes = size_t {ROUNDS} * PAYLOADS * payloads.front().size();
+        std::cout << levelName(kernel.level) << ": " << (correct ? "correct" : "WRONG")
+            << ", crc32c " << gigabytesPerSecond(bytes, checksummed - start) << " GB/s"
+            << ", byte swap " << gigabytesPerSecond(bytes, swappedAll - checksummed) << " GB/s"
+            << " (digest " << std::hex << digest << std::dec << ")\n";
+    }
+
+    // what load pays on top of deserialization, one pass checks and transforms every payload
+    auto data = Data {};
+    for (auto& payload : payloads)
+    {
+        auto model = std::make_unique<ModelObjectData>();
+        model->mutablePayload() = payload;
+        data.objects.push_back(std::move(model));
+    }
+    const auto start = BenchClock::now();
+    for (auto round = 0; round < ROUNDS; ++round)
+    {
+        processPayloads(data, PayloadTransform::ByteSwap32);
+    }
+    const auto elapsed = BenchClock::now() - start;
+    std::cout << "processPayloads: "
+        << std::chrono::duration<double, std::milli>(elapsed).count() / ROUNDS << " ms per "
+        << PAYLOADS << " objects\n";
+    std::cout << std::defaultfloat;
+}
+
+void simulateScheduler(const std::string& tracePath)
+{
+    auto trace = std::vector<TraceEvent> {};
+    if (tracePath.empty())
+    {
+        trace = makeStreamingTrace();
+    }
+    else if (!loadTrace(tracePath, trace))
+    {
+        return;
+    }
+    std::cout << "Trace: " << trace.size() << " events\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto ordering : {LoadScheduler::Ordering::Fifo, LoadScheduler::Ordering::Priority})
+    {
+        const auto result = replay(trace, ordering);
+        std::cout << (ordering == LoadScheduler::Ordering::Fifo ? "fifo" : "priority")
+            << ": " << result.stats.completed << " loads, " << result.stats.cancelled << " cancelled, "
+            << result.stats.deadlineMisses << " deadline misses, urgent wait mean " << result.urgentMeanMs
+            << " ms, max " << result.urgentMaxMs << " ms\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+void benchmarkLazyLoad()
+{
+    constexpr auto OBJECTS = 20000;
+    constexpr auto ROUNDS = 5;
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto fullPath = (directory / "resmgr_bench_lazy.txt").string();
+    const auto lazyPath = (directory / "resmgr_bench_lazy.lazy").string();
+    {
+        auto data = Data {};
+        data.duration = 10.0f;
+        for (auto i = 0; i < OBJECTS; ++i)
+        {
+            auto model = std::make_unique<ModelObjectData>();
+            model->name = "Model " + std::to_string(i);
+            auto& payload = model->mutablePayload();
+            for (size_t j = 0; j < payload.size(); ++j)
+            {
+                payload[j] = static_cast<unsigned char>(i + j);
+            }
+            data.objects.push_back(std::move(model));
+        }
+        auto file = std::fstream {fullPath, std::fstream::out | std::fstream::binary};
+        boost::archive::binary_oarchive ar {file};
+        ar << data;
+        if (!saveLazy(lazyPath, data))
+        {
+            return;
+        }
+    }
+
+    // first use is of object in the middle, so lazy load pays for one body only
+    const auto milliseconds = [](BenchClock::duration elapsed)
+    {
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    };
+    auto fullFirstUse = 0.0;
+    auto lazyFirstUse = 0.0;
+    auto lazyAllBodies = 0.0;
+    auto fullResident = size_t {0};
+    auto lazyResident = size_t {0};
+    auto lazyResidentAll = size_t {0};
+    auto checksum = 0u;
+    for (auto round = 0; round < ROUNDS; ++round)
+    {
+        {
+            const auto start = BenchClock::now();
+            auto data = Data {};
+            auto file = std::ifstream {fullPath, std::ifstream::binary};
+            boost::archive::binary_iarchive ar {file};
+            ar >> data;
+            checksum += static_cast<const ModelObjectData&>(*data.objects[OBJECTS / 2]).payload()[0];
+            fullFirstUse += milliseconds(BenchClock::now() - start);
+            fullResident = resourceSize(data);
+        }
+        {
+            const auto start = BenchClock::now();
+            auto data = Data {};
+            if (!loadLazy(lazyPath, data))
+            {
+                return;
+            }
+            checksum += static_cast<const ModelObjectData&>(*data.objects[OBJECTS / 2]).payload()[0];
+            const auto used = BenchClock::now();
+            lazyFirstUse += milliseconds(used - start);
+            lazyResident = resourceSize(data);
+            for (auto& object : data.objects)
+            {
+                object->materialize();
+            }
+            lazyAllBodies += milliseconds(BenchClock::now() - used);
+            lazyResidentAll = resourceSize(data);
+        }
+    }
+    std::filesystem::remove(fullPath);
+    std::filesystem::remove(lazyPath);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << OBJECTS << " objects, mean of " << ROUNDS << " rounds (checksum " << checksum << ")\n";
+    std::cout << "full load: " << fullFirstUse / ROUNDS << " ms to first use, "
+        << fullResident / 1024 << " KB resident\n";
+    std::cout << "lazy load: " << lazyFirstUse / ROUNDS << " ms to first use, "
+        << lazyResident / 1024 << " KB resident\n";
+    std::cout << "lazy, all bodies read: " << lazyAllBodies / ROUNDS << " ms more, "
+        << lazyResidentAll / 1024 << " KB resident\n";
+    std::cout << std::defaultfloat;
+}
+
+void benchmarkAsyncLoads()
+{
+    using namespace std::string_literals;
+    constexpr auto FILES = 400;
+    constexpr auto OBJECTS = 64;
+    const auto directory = std::filesystem::temp_directory_path() / "resmgr_bench_async";
+    std::filesystem::create_directories(directory);
+
+    auto data = Data {};
+    for (auto i = 0; i < OBJECTS; ++i)
+    {
+        auto model = std::make_unique<ModelObjectData>();
+        model->name = "Model " + std::to_string(i);
+        model->mutablePayload().fill(static_cast<unsigned char>(i));
+        data.objects.push_back(std::move(model));
+    }
+    auto fullPaths = std::vector<std::string> {};
+    auto lazyPaths = std::vector<std::string> {};
+    for (auto i = 0; i < FILES; ++i)
+    {
+        fullPaths.push_back((directory / ("bench" + std::to_string(i) + ".txt")).string());
+        {
+            auto file = std::fstream {fullPaths.back(), std::fstream::out | std::fstream::binary};
+            boost::archive::binary_oarchive ar {file};
+            ar << data;
+        }
+        lazyPaths.push_back((directory / ("bench" + std::to_string(i) + ".lazy")).string());
+        if (!saveLazy(lazyPaths.back(), data))
+        {
+            return;
+        }
+    }
+    FstreamFactory<Data>::instance(std::vector<std::string> {".txt"s});
+    LazyFstreamFactory<Data>::instance(std::vector<std::string> {".lazy"s});
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << FILES << " files of " << OBJECTS << " objects, " << std::thread::hardware_concurrency()
+        << " hardware threads, " << LoadQueues::DEFAULT_IO_THREADS << " io slots\n";
+    measureLoads<FstreamFactory<Data>>("fstream", fullPaths);
+    measureLoads<LazyFstreamFactory<Data>>("lazy", lazyPaths);
+    std::cout << std::defaultfloat;
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+//---------------------------------------------------------------------------------------------------------------------
+// Measurements, run with benchmark name as first argument of TestShareds
+//---------------------------------------------------------------------------------------------------------------------
+// "bench-payload": checks every payload kernel supported by this cpu against scalar one, then measures it
+void benchmarkPayloadKernels();
+
+// "simulate-scheduler [trace]": replays streaming trace, or one recorded by Factory::recordTrace,
+// through LoadScheduler with simulated time, fifo against priority
+void simulateScheduler(const std::string& tracePath);
+
+// "bench-lazy": full load against lazy load of many small objects, time to first use and memory held
+void benchmarkLazyLoad();
+
+// "bench-async": many small files loaded blocking one by one against async, for every file factory
+void benchmarkAsyncLoads();
@@ -0,0 +1,211 @@
+#include "stdafx.h"
+#include "PayloadProcessing.h"
+
+#include <array>
+#include <cstring>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PAYLOAD_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+// MSVC allows any intrinsic without per function targets
+#define PAYLOAD_TARGET(isa)
+#else
+#include <immintrin.h>
+#define PAYLOAD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace
+{
+//---------------------------------------------------------------------------------------------------------------------
+// Scalar
+//---------------------------------------------------------------------------------------------------------------------
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78u; // reflected
+
+constexpr std::array<uint32_t, 256> makeCrc32cTable()
+{
+    auto table = std::array<uint32_t, 256> {};
+    for (auto i = 0u; i < 256; ++i)
+    {
+        auto crc = i;
+        for (auto bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1u)));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr auto CRC32C_TABLE = makeCrc32cTable();
+
+uint32_t crc32cScalar(const unsigned char* bytes, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+    for (auto i = size_t {0}; i < size; ++i)
+    {
+        crc = CRC32C_TABLE[(crc ^ bytes[i]) & 0xFFu] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void byteSwap32Scalar(unsigned char* bytes, size_t size)
+{
+    for (auto i = size_t {0}; i + 4 <= size; i += 4)
+    {
+        std::swap(bytes[i], bytes[i + 3]);
+        std::swap(bytes[i + 1], bytes[i + 2]);
+    }
+}
+
+#if defined(PAYLOAD_X86)
+//---------------------------------------------------------------------------------------------------------------------
+// SSE4.2 / SSSE3
+//---------------------------------------------------------------------------------------------------------------------
+PAYLOAD_TARGET("sse4.2")
+uint32_t crc32cSse42(const unsigned char* bytes, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+    auto i = size_t {0};
+#if defined(_M_X64) || defined(__x86_64__)
+    auto wide = uint64_t {crc};
+    for (; i + 8 <= size; i += 8)
+    {
+        auto word = uint64_t {};
+        memcpy(&word, bytes + i, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = static_cast<uint32_t>(wide);
+#endif
+    for (; i + 4 <= size; i += 4)
+    {
+        auto word = uint32_t {};
+        memcpy(&word, bytes + i, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; i < size; ++i)
+    {
+        crc = _mm_crc32_u8(crc, bytes[i]);
+    }
+    return ~crc;
+}
+
+PAYLOAD_TARGET("ssse3")
+void byteSwap32Ssse3(unsigned char* bytes, size_t size)
+{
+    const auto mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    auto i = size_t {0};
+    for (; i + 16 <= size; i += 16)
+    {
+        const auto p = reinterpret_cast<__m128i*>(bytes + i);
+        _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+    }
+    byteSwap32Scalar(bytes + i, size - i);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// AVX2
+//---------------------------------------------------------------------------------------------------------------------
+PAYLOAD_TARGET("avx2")
+void byteSwap32Avx2(unsigned char* bytes, size_t size)
+{
+    // shuffle works within 128 bit lanes, so same pattern twice
+    const auto mask = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    auto i = size_t {0};
+    for (; i + 32 <= size; i += 32)
+    {
+        const auto p = reinterpret_cast<__m256i*>(bytes + i);
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), mask));
+    }
+    byteSwap32Ssse3(bytes + i, size - i);
+}
+
+bool osSupportsAvx()
+{
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 1);
+    const auto osxsave = (info[2] & (1 << 27)) != 0;
+    const auto avx = (info[2] & (1 << 28)) != 0;
+    // ymm state enabled by os
+    return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+CpuLevel detectCpuLevelOnce()
+{
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    const auto maxLeaf = info[0];
+    __cpuid(info, 1);
+    const auto ssse3 = (info[2] & (1 << 9)) != 0;
+    const auto sse42 = (info[2] & (1 << 20)) != 0;
+    auto avx2 = false;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    const auto ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    const auto sse42 = __builtin_cpu_supports("sse4.2") != 0;
+    const auto avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+    if (ssse3 && sse42 && avx2 && osSupportsAvx())
+        return CpuLevel::Avx2;
+    if (ssse3 && sse42)
+        return CpuLevel::Sse42;
+    return CpuLevel::Scalar;
+}
+#else
+CpuLevel detectCpuLevelOnce()
+{
+    return CpuLevel::Scalar;
+}
+#endif
+}
+
+CpuLevel detectCpuLevel()
+{
+    static const auto level = detectCpuLevelOnce();
+    return level;
+}
+
+const PayloadKernel& payloadKernel()
+{
+    static const auto kernel = payloadKernel(detectCpuLevel());
+    return kernel;
+}
+
+PayloadKernel payloadKernel(CpuLevel level)
+{
+    auto kernel = PayloadKernel {};
+    kernel.level = level;
+    kernel.crc32c = crc32cScalar;
+    kernel.byteSwap32 = byteSwap32Scalar;
+#if defined(PAYLOAD_X86)
+    switch (level)
+    {
+    case CpuLevel::Avx2:
+        kernel.crc32c = crc32cSse42; // wider registers do not help crc instruction
+        kernel.byteSwap32 = byteSwap32Avx2;
+        break;
+    case CpuLevel::Sse42:
+        kernel.crc32c = crc32cSse42;
+        kernel.byteSwap32 = byteSwap32Ssse3;
+        break;
+    case CpuLevel::Scalar:
+        break;
+    }
+#endif
+    return kernel;
+}
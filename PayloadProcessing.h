@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+//---------------------------------------------------------------------------------------------------------------------
+// Byte kernels for payload processing during load
+//---------------------------------------------------------------------------------------------------------------------
+enum class CpuLevel
+{
+    Scalar,
+    Sse42, // with SSSE3
+    Avx2
+};
+
+enum class PayloadTransform
+{
+    None,
+    ByteSwap32 // fix endianness of 32 bit words, tail shorter than a word is left as is
+};
+
+// best level supported by cpu and os, detected once
+CpuLevel detectCpuLevel();
+
+struct PayloadKernel
+{
+    CpuLevel level = CpuLevel::Scalar;
+
+    // CRC32C (Castagnoli), chainable: crc32c(b, crc32c(a)) == crc32c(a + b)
+    uint32_t (*crc32c)(const unsigned char* bytes, size_t size, uint32_t crc) = nullptr;
+
+    void (*byteSwap32)(unsigned char* bytes, size_t size) = nullptr;
+};
+
+// kernel for detected level
+const PayloadKernel& payloadKernel();
+
+// kernel for exact level, do not call with level above detectCpuLevel()
+PayloadKernel payloadKernel(CpuLevel level);
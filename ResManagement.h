@@ -5,12 +5,43 @@
 
 #include <boost/signals2/signal.hpp>
 
+#include "ResManagementDebug.h"
+
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <streambuf>
+#include <chrono>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <limits>
 #include <fstream>
 #include <filesystem>
 #include <unordered_map>
 
+// co_await support: C++20 coroutines or Coroutines TS of MSVC (/await)
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define RESMGR_COROUTINES 1
+namespace resmgr_coro = std;
+#endif
+#elif defined(_RESUMABLE_FUNCTIONS_SUPPORTED)
+#include <experimental/coroutine>
+#define RESMGR_COROUTINES 1
+namespace resmgr_coro = std::experimental;
+#endif
+#ifndef RESMGR_COROUTINES
+#define RESMGR_COROUTINES 0
+#endif
+
 //---------------------------------------------------------------------------------------------------------------------
 // Support
 //---------------------------------------------------------------------------------------------------------------------
@@ -31,9 +62,9 @@ public:
     }
 
 protected:
-    explicit Singleton<T>() {}
+    explicit Singleton() {}
 
-    ~Singleton<T>() {}
+    ~Singleton() {}
 
     Singleton(const Singleton&) = delete;
 
@@ -49,6 +80,426 @@ private:
     }
 };
 
+// Shared pointer read and replaced from many threads. C++20 atomic<shared_ptr> guards each pointer on its own,
+// C++17 fallback goes through atomic_load/atomic_store which share global lock pool.
+// libstdc++ 12 unlocks reader side of atomic<shared_ptr> with relaxed order, ThreadSanitizer builds use fallback
+#if defined(__cpp_lib_atomic_shared_ptr) && !(defined(__GLIBCXX__) && defined(__SANITIZE_THREAD__))
+#define RESMGR_ATOMIC_SHARED_PTR 1
+#else
+#define RESMGR_ATOMIC_SHARED_PTR 0
+#endif
+
+template <typename T>
+class AtomicSharedPtr
+{
+public:
+    AtomicSharedPtr() = default;
+
+    explicit AtomicSharedPtr(std::shared_ptr<T> initial)
+        : m_value(std::move(initial)) {}
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+
+    const AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    std::shared_ptr<T> load() const
+    {
+#if RESMGR_ATOMIC_SHARED_PTR
+        return m_value.load();
+#else
+        return std::atomic_load(&m_value);
+#endif
+    }
+
+    void store(std::shared_ptr<T> value)
+    {
+#if RESMGR_ATOMIC_SHARED_PTR
+        m_value.store(std::move(value));
+#else
+        std::atomic_store(&m_value, std::move(value));
+#endif
+    }
+
+private:
+#if RESMGR_ATOMIC_SHARED_PTR
+    std::atomic<std::shared_ptr<T>> m_value;
+#else
+    std::shared_ptr<T> m_value;
+#endif
+};
+
+// Readers pin current version by taking a snapshot, writer publishes a new one atomically.
+// Previous version is released when the last snapshot holding it goes away.
+template <typename T>
+class Versioned
+{
+public:
+    using Snapshot = std::shared_ptr<const T>;
+
+    Versioned() = default;
+
+    explicit Versioned(std::shared_ptr<const T> initial)
+        : m_current(std::move(initial)) {}
+
+    Versioned(const Versioned&) = delete;
+
+    const Versioned& operator=(const Versioned&) = delete;
+
+    Snapshot snapshot() const
+    {
+        return m_current.load();
+    }
+
+    void publish(std::shared_ptr<const T> next)
+    {
+        m_current.store(std::move(next));
+    }
+
+private:
+    AtomicSharedPtr<const T> m_current;
+};
+
+// Fixed set of worker threads running posted tasks in order.
+// Destructor runs what is left in queue and joins workers.
+class TaskQueue
+{
+public:
+    explicit TaskQueue(size_t threads)
+    {
+        m_workers.reserve(threads);
+        for (auto i = size_t {0}; i < threads; ++i)
+        {
+            m_workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~TaskQueue()
+    {
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    TaskQueue(const TaskQueue&) = delete;
+
+    const TaskQueue& operator=(const TaskQueue&) = delete;
+
+    void post(std::function<void()> task)
+    {
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            m_tasks.push_back(std::move(task));
+        }
+        m_wake.notify_one();
+    }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard {m_access};
+                m_wake.wait(guard, [this] { return m_stop || !m_tasks.empty(); });
+                if (m_tasks.empty())
+                    return;
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            // worker should outlive any task, task reports its own failures
+            try
+            {
+                task();
+            }
+            catch (const std::exception& e)
+            {
+                std::cout << "ERROR: task failed! " << e.what() << "\n";
+            }
+            catch (...)
+            {
+                std::cout << "ERROR: task failed!\n";
+            }
+        }
+    }
+
+    std::mutex m_access;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stop = false;
+    std::vector<std::thread> m_workers;
+};
+
+// Read only view of bytes for streams and archives, nothing is copied
+class MemoryStreambuf : public std::streambuf
+{
+public:
+    MemoryStreambuf(const char* data, size_t size)
+    {
+        const auto begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+// Workers for async loads: few threads waiting on files, the rest is for deserialization
+class LoadQueues : public Singleton<LoadQueues>
+{
+    friend class Singleton<LoadQueues>;
+
+public:
+    static constexpr size_t DEFAULT_IO_THREADS = 4;
+
+    TaskQueue& io()
+    {
+        return m_io;
+    }
+
+    TaskQueue& cpu()
+    {
+        return m_cpu;
+    }
+
+    // True while this thread reads file of some load under io slot. Blocking load nested in doRead
+    // reads right away then, waiting for another slot could wait for itself
+    static bool& holdingIoSlot()
+    {
+        thread_local auto holding = false;
+        return holding;
+    }
+
+protected:
+    LoadQueues()
+        : LoadQueues(DEFAULT_IO_THREADS, std::max(1u, std::thread::hardware_concurrency())) {}
+
+    LoadQueues(size_t ioThreads, size_t cpuThreads)
+        : m_io(ioThreads)
+        , m_cpu(cpuThreads) {}
+
+private:
+    TaskQueue m_io;
+    TaskQueue m_cpu;
+};
+
+struct LoadPriority
+{
+    using Clock = std::chrono::steady_clock;
+
+    // thread is blocked until load is done, goes before any async load
+    static constexpr int BLOCKING = std::numeric_limits<int>::max();
+
+    // higher goes first
+    int priority = 0;
+    // soft: late load still completes, but counted as miss
+    std::optional<Clock::time_point> deadline;
+};
+
+// Decides which queued load goes next and how many are allowed to run at once.
+// Policy only: no threads and no clock of its own, caller tells it what started and finished and when,
+// so recorded traces could be replayed with simulated time. Not thread safe.
+class LoadScheduler
+{
+public:
+    using Clock = LoadPriority::Clock;
+    using Id = uint64_t;
+
+    enum class Ordering
+    {
+        Priority, // priority, then earliest deadline, then arrival
+        Fifo      // arrival only, for comparison
+    };
+
+    struct Stats
+    {
+        uint64_t completed = 0;
+        uint64_t cancelled = 0;
+        // one per deadline of every request joined to load, late completion or cancel after deadline
+        uint64_t deadlineMisses = 0;
+        // deadlines already passed of loads not finished yet, not in deadlineMisses until they finish
+        uint64_t overdue = 0;
+    };
+
+    explicit LoadScheduler(size_t maxRunning, Ordering ordering = Ordering::Priority)
+        : m_maxRunning(maxRunning)
+        , m_ordering(ordering) {}
+
+    Id enqueue(const LoadPriority& priority)
+    {
+        const auto id = m_nextId++;
+        auto& request = m_requests[id];
+        request.id = id;
+        request.priority = priority;
+        request.requests.push_back(priority);
+        m_queue.insert(keyOf(request));
+        return id;
+    }
+
+    // Another request for the same load. Its deadline is checked on its own,
+    // while queued load goes as urgent as most urgent of its requests
+    bool join(Id id, const LoadPriority& priority)
+    {
+        const auto request = m_requests.find(id);
+        if (request == end(m_requests))
+            return false;
+        request->second.requests.push_back(priority);
+        if (!request->second.running)
+        {
+            requeue(request->second);
+        }
+        return true;
+    }
+
+    // Only queued request could be changed. Changes request which started load, requests joined later
+    // keep their priority and deadline, so load never goes below most urgent of them
+    bool reprioritize(Id id, const LoadPriority& priority)
+    {
+        const auto request = m_requests.find(id);
+        if (request == end(m_requests) || request->second.running)
+            return false;
+        request->second.requests.front() = priority;
+        requeue(request->second);
+        return true;
+    }
+
+    // only queued request could be cancelled, deadlines already passed are counted as missed
+    bool cancel(Id id, Clock::time_point now)
+    {
+        const auto request = m_requests.find(id);
+        if (request == end(m_requests) || request->second.running)
+            return false;
+        m_queue.erase(keyOf(request->second));
+        m_stats.deadlineMisses += missed(request->second, now);
+        m_requests.erase(request);
+        ++m_stats.cancelled;
+        return true;
+    }
+
+    // takes slot for next request, if any is queued and slot is free
+    std::optional<Id> next()
+    {
+        if (m_running >= m_maxRunning || m_queue.empty())
+            return {};
+        const auto id = std::get<Id>(*begin(m_queue));
+        m_queue.erase(begin(m_queue));
+        m_requests[id].running = true;
+        ++m_running;
+        return id;
+    }
+
+    // io part is done, slot is free for next one
+    void release(Id id)
+    {
+        auto& request = m_requests[id];
+        if (request.running && !request.released)
+        {
+            request.released = true;
+            --m_running;
+        }
+    }
+
+    // returns number of missed deadlines
+    size_t complete(Id id, Clock::time_point now)
+    {
+        release(id);
+        const auto request = m_requests.find(id);
+        const auto misses = missed(request->second, now);
+        m_requests.erase(request);
+        ++m_stats.completed;
+        m_stats.deadlineMisses += misses;
+        return misses;
+    }
+
+    std::optional<LoadPriority> priority(Id id) const
+    {
+        const auto request = m_requests.find(id);
+        if (request == end(m_requests))
+            return {};
+        return request->second.priority;
+    }
+
+    Stats stats(Clock::time_point now) const
+    {
+        auto stats = m_stats;
+        for (auto& request : m_requests)
+        {
+            stats.overdue += missed(request.second, now);
+        }
+        return stats;
+    }
+
+    size_t queued() const
+    {
+        return m_queue.size();
+    }
+
+    size_t running() const
+    {
+        return m_running;
+    }
+
+private:
+    struct Request
+    {
+        // merged, used for ordering
+        LoadPriority priority;
+        // of every request joined to this load, first one started it
+        std::vector<LoadPriority> requests;
+        Id id = 0;
+        bool running = false;
+        bool released = false;
+    };
+
+    // negated priority so set begins with the highest, no deadline goes after any deadline
+    using Key = std::tuple<int, Clock::time_point, Id>;
+
+    Key keyOf(const Request& request) const
+    {
+        if (m_ordering == Ordering::Fifo)
+            return Key {0, Clock::time_point {}, request.id};
+        return Key {
+            -request.priority.priority,
+            request.priority.deadline.value_or(Clock::time_point::max()),
+            request.id};
+    }
+
+    // queued request only, goes as urgent as most urgent of its requests
+    void requeue(Request& request)
+    {
+        m_queue.erase(keyOf(request));
+        auto merged = request.requests.front();
+        for (auto& joined : request.requests)
+        {
+            merged.priority = std::max(merged.priority, joined.priority);
+            if (joined.deadline && (!merged.deadline || *joined.deadline < *merged.deadline))
+            {
+                merged.deadline = joined.deadline;
+            }
+        }
+        request.priority = merged;
+        m_queue.insert(keyOf(request));
+    }
+
+    static size_t missed(const Request& request, Clock::time_point now)
+    {
+        return static_cast<size_t>(std::count_if(
+            begin(request.requests), end(request.requests),
+            [now](auto& joined) { return joined.deadline && now > *joined.deadline; }));
+    }
+
+    size_t m_maxRunning;
+    Ordering m_ordering;
+    Id m_nextId = 0;
+    size_t m_running = 0;
+    std::set<Key> m_queue;
+    std::unordered_map<Id, Request> m_requests;
+    Stats m_stats;
+};
+
 //---------------------------------------------------------------------------------------------------------------------
 // Resource management
 //---------------------------------------------------------------------------------------------------------------------
@@ -80,7 +531,7 @@ public:
 template <typename Implementation, typename T>
 class Factory : public Singleton<Implementation>
 {
-    // declared somewhere else
+    // declared in ResManagementDebug.h
     friend class DebugInterface;
 
 public:
@@ -94,20 +545,133 @@ public:
     using RequestReloadSignal = boost::signals2::signal<void()>;
     using ReloadDoneSignal = boost::signals2::signal<void()>;
     
-    struct Resource
+    struct ResourceSignals
     {
-        TypeWeakPtr resource;
         RequestReloadSignal requestReload;
         ReloadDoneSignal reloadDone;
     };
 
+    struct Resource
+    {
+        TypeWeakPtr resource;
+        // deleter of each loaded version knows its number and erases entry only while entry points to it
+        uint64_t version = 0;
+        // shared so reload could emit them out of lock whatever happens to entry meanwhile
+        std::shared_ptr<ResourceSignals> signals = std::make_shared<ResourceSignals>();
+#if RESMGR_TRACKING
+        ResourceTracking tracking;
+#endif
+    };
+
     using CacheType = std::unordered_map<ResourcePathType, Resource>;
 
+    using LoadCallback = std::function<void(TypeSharedPtr)>;
+
+    // Blocks, though waits for io slot like loadAsync and goes before any queued async load
     static TypeSharedPtr load(const ResourcePathType& resource)
     {
         return Factory::instance().loadInternal(resource);
     }
 
+    // Does not block: file is read on io queue and deserialized on cpu queue of LoadQueues.
+    // Concurrent requests for one resource share single load. Done is called with empty pointer on failure
+    // or cancel, right away when resource is cached or from worker thread otherwise.
+    // All async loads should be finished before shutdown.
+    static void loadAsync(const ResourcePathType& resource, LoadCallback done)
+    {
+        Factory::instance().loadAsyncInternal(resource, LoadPriority {}, std::move(done));
+    }
+
+    // Queued loads go by priority, then deadline, and only few read files at once
+    static void loadAsync(const ResourcePathType& resource, const LoadPriority& priority, LoadCallback done)
+    {
+        Factory::instance().loadAsyncInternal(resource, priority, std::move(done));
+    }
+
+#if RESMGR_COROUTINES
+    // Thin adapter over loadAsync: co_await resumes on worker thread, or does not suspend when cached
+    class LoadAwaitable
+    {
+    public:
+        LoadAwaitable(ResourcePathType resource, const LoadPriority& priority)
+            : m_resource(std::move(resource))
+            , m_priority(priority) {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(resmgr_coro::coroutine_handle<> waiting)
+        {
+            Factory::loadAsync(m_resource, m_priority, [this, waiting](TypeSharedPtr data)
+            {
+                m_result = std::move(data);
+                // the later of callback and await_suspend continues coroutine
+                if (m_finished.exchange(true))
+                {
+                    waiting.resume();
+                }
+            });
+            return !m_finished.exchange(true);
+        }
+
+        TypeSharedPtr await_resume()
+        {
+            return std::move(m_result);
+        }
+
+    private:
+        ResourcePathType m_resource;
+        LoadPriority m_priority;
+        TypeSharedPtr m_result;
+        std::atomic<bool> m_finished {false};
+    };
+
+    static LoadAwaitable loadAwaitable(const ResourcePathType& resource, const LoadPriority& priority = {})
+    {
+        return LoadAwaitable {resource, priority};
+    }
+#endif
+
+    // For queued load only, e.g. when camera moved. Replaces priority of request which started load,
+    // requests joined later keep theirs. False when it already started or not requested
+    static bool reprioritize(const ResourcePathType& resource, const LoadPriority& priority)
+    {
+        return Factory::instance().reprioritizeInternal(resource, priority);
+    }
+
+    // For queued load only, waiting callbacks get empty pointer. False when it already started or not requested
+    static bool cancel(const ResourcePathType& resource)
+    {
+        return Factory::instance().cancelInternal(resource);
+    }
+
+    // Writes load requests, reprioritizes, cancels and read times, simulate-scheduler replays them.
+    // One event per line: "<at us> request|reprioritize <priority> <deadline us from event|-> <resource>",
+    // "<at us> cancel <resource>" and "<at us> read <us> <resource>". Pass nullptr to stop,
+    // stream should outlive recording
+    static void recordTrace(std::ostream* trace)
+    {
+        auto& manager = Factory::instance();
+        std::scoped_lock<std::mutex> guard {manager.m_access};
+        manager.m_trace = trace;
+        manager.m_traceStart = LoadScheduler::Clock::now();
+    }
+
+    static LoadScheduler::Stats schedulerStats()
+    {
+        auto& manager = Factory::instance();
+        std::scoped_lock<std::mutex> guard {manager.m_access};
+        return manager.m_scheduler.stats(LoadScheduler::Clock::now());
+    }
+
+    // Publishes new version of cached resource, holders of previous one keep it until they release it
+    static TypeSharedPtr reload(const ResourcePathType& resource)
+    {
+        return Factory::instance().reloadInternal(resource);
+    }
+
     // Send by value to pin resource while saving
     static bool save(const ResourcePathType& resource, TypeSharedPtr data)
     {
@@ -118,13 +682,15 @@ public:
         const ResourcePathType& resource,
         IReloadableBase& user)
     {
-        auto& signals = Factory::instance().m_cache;
+        auto& manager = Factory::instance();
+        std::scoped_lock<std::mutex> guard {manager.m_access};
+        auto& signals = manager.m_cache;
         auto sig = signals.find(resource);
         if (sig != std::end(signals))
         {
-            user.requestReloadConnection = sig->second.requestReload.connect(
+            user.requestReloadConnection = sig->second.signals->requestReload.connect(
                 std::bind(&IReloadableBase::requestReload, &user));
-            user.reloadDoneConnection = sig->second.reloadDone.connect(
+            user.reloadDoneConnection = sig->second.signals->reloadDone.connect(
                 std::bind(&IReloadableBase::reloadDone, &user));
         }
     }
@@ -137,8 +703,22 @@ public:
             if (!kv.second.resource.expired())
             {
                 std::cout << "ERROR: Resource " << kv.first << " leaked!\n";
+#if RESMGR_TRACKING
+                DebugInterface::dumpSamples(std::cout, kv.second.tracking.samples);
+#endif
             }
         }
+#if RESMGR_TRACKING
+        for (auto& kv : m_versions)
+        {
+            const auto cached = m_cache.find(kv.second.path);
+            const auto current = cached != end(m_cache) && cached->second.version == kv.first;
+            if (!current && !kv.second.resource.expired())
+            {
+                std::cout << "ERROR: Resource " << kv.second.path << " superseded version leaked!\n";
+            }
+        }
+#endif
     }
 
 protected:
@@ -148,6 +728,18 @@ protected:
 
     virtual bool doSave(std::string_view resource, ValueType& data) = 0;
 
+    // Async load is split in io part and cpu part.
+    // By default nothing is read upfront and whole blocking load goes to cpu part.
+    virtual bool doRead(std::string_view resource, std::string& bytes)
+    {
+        return true;
+    }
+
+    virtual bool doDeserialize(std::string_view resource, const std::string& bytes, ValueType& data)
+    {
+        return doLoad(resource, data);
+    }
+
 private:
 
     TypeSharedPtr loadInternal(const std::string& path)
@@ -166,7 +758,7 @@ private:
 
         auto unique = std::make_unique<ValueType>();
 
-        if (!doLoad(path, *unique))
+        if (!loadBlocking(path, *unique))
         {
             // not loaded correctly
             return {};
@@ -174,18 +766,320 @@ private:
 
         {
             std::scoped_lock<std::mutex> guard {m_access};
-            // try to find again
-            auto cached = getFromCache(path);
-            if (cached)
-                return cached;
+            auto shared = putToCache(path, std::move(unique));
+#if RESMGR_TRACKING
+            m_cache[path].tracking.acquired();
+#endif
+            return shared;
+        }
+    }
+
+    void loadAsyncInternal(const std::string& path, const LoadPriority& priority, LoadCallback done)
+    {
+        if (!hasValidExtension(path))
+        {
+            done({});
+            return;
+        }
+
+        std::unique_lock<std::mutex> guard {m_access};
+        auto cached = getFromCache(path);
+        if (cached)
+        {
+            guard.unlock();
+            done(std::move(cached));
+            return;
+        }
+        const auto inFlight = m_pending.find(path);
+        if (inFlight != end(m_pending))
+        {
+            // shared load goes as urgent as most urgent of its requests, each deadline is checked on its own
+            inFlight->second.waiting.push_back(std::move(done));
+#if RESMGR_TRACKING
+            // worker thread which finishes load would only see itself
+            inFlight->second.samples.push_back(ResourceTracking::capture());
+#endif
+            m_scheduler.join(inFlight->second.id, priority);
+            traceRequest("request", path, priority);
+            return;
+        }
+        traceRequest("request", path, priority);
+        auto& pending = m_pending[path];
+        pending.id = m_scheduler.enqueue(priority);
+        pending.waiting.push_back(std::move(done));
+#if RESMGR_TRACKING
+        pending.samples.push_back(ResourceTracking::capture());
+#endif
+        m_scheduled[pending.id] = path;
+        startScheduled();
+    }
+
+    bool reprioritizeInternal(const std::string& path, const LoadPriority& priority)
+    {
+        std::scoped_lock<std::mutex> guard {m_access};
+        const auto pending = m_pending.find(path);
+        if (pending == end(m_pending) || !m_scheduler.reprioritize(pending->second.id, priority))
+        {
+            return false;
+        }
+        traceRequest("reprioritize", path, priority);
+        return true;
+    }
+
+    bool cancelInternal(const std::string& path)
+    {
+        std::vector<LoadCallback> waiting;
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            const auto pending = m_pending.find(path);
+            if (pending == end(m_pending) || !m_scheduler.cancel(pending->second.id, LoadScheduler::Clock::now()))
+            {
+                return false;
+            }
+            waiting = std::move(pending->second.waiting);
+            m_scheduled.erase(pending->second.id);
+            m_pending.erase(pending);
+            if (m_trace)
+            {
+                *m_trace << traceTime(LoadScheduler::Clock::now()) << " cancel " << path << "\n";
+            }
+        }
+        for (auto& done : waiting)
+        {
+            done({});
+        }
+        return true;
+    }
+
+    // Blocking load waits for io slot like async ones, so disk is not oversubscribed and queued urgent
+    // loads are not overtaken. Slot is held only by doRead, doDeserialize runs on calling thread after it.
+    // Nested in doRead of any factory it reads right away and is not counted by scheduler
+    bool loadBlocking(const std::string& path, ValueType& data)
+    {
+        auto id = std::optional<LoadScheduler::Id> {};
+        if (!LoadQueues::holdingIoSlot())
+        {
+            std::unique_lock<std::mutex> guard {m_access};
+            auto priority = LoadPriority {};
+            priority.priority = LoadPriority::BLOCKING;
+            id = m_scheduler.enqueue(priority);
+            traceRequest("request", path, priority);
+            m_blocking[*id] = false;
+            startScheduled();
+            m_slotGranted.wait(guard, [this, &id] { return m_blocking[*id]; });
+            m_blocking.erase(*id);
+        }
+        auto bytes = std::string {};
+        const auto started = LoadScheduler::Clock::now();
+        const auto read = readHoldingSlot(path, bytes);
+        if (id)
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            traceRead(path, started);
+            m_scheduler.release(*id);
+            startScheduled();
+        }
+        auto loaded = false;
+        try
+        {
+            loaded = read && doDeserialize(path, bytes, data);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "ERROR: cannot read file! " << path << " " << e.what() << "\n";
+        }
+        if (id)
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            m_scheduler.complete(*id, LoadScheduler::Clock::now());
+        }
+        return loaded;
+    }
+
+    // should be called with io slot taken
+    bool readHoldingSlot(const std::string& path, std::string& bytes)
+    {
+        auto& holding = LoadQueues::holdingIoSlot();
+        const auto nested = holding;
+        holding = true;
+        auto read = false;
+        try
+        {
+            read = doRead(path, bytes);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "ERROR: cannot read file! " << path << " " << e.what() << "\n";
+        }
+        holding = nested;
+        return read;
+    }
+
+    // should be called under m_access
+    void traceRequest(const char* kind, const std::string& path, const LoadPriority& priority)
+    {
+        if (!m_trace)
+            return;
+        const auto now = LoadScheduler::Clock::now();
+        *m_trace << traceTime(now) << " " << kind << " " << priority.priority << " ";
+        if (priority.deadline)
+        {
+            *m_trace << std::chrono::duration_cast<std::chrono::microseconds>(*priority.deadline - now).count();
+        }
+        else
+        {
+            *m_trace << "-";
+        }
+        *m_trace << " " << path << "\n";
+    }
+
+    // should be called under m_access
+    void traceRead(const std::string& path, LoadScheduler::Clock::time_point started)
+    {
+        if (!m_trace)
+            return;
+        const auto now = LoadScheduler::Clock::now();
+        *m_trace << traceTime(now) << " read "
+            << std::chrono::duration_cast<std::chrono::microseconds>(now - started).count() << " " << path << "\n";
+    }
+
+    long long traceTime(LoadScheduler::Clock::time_point now) const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(now - m_traceStart).count();
+    }
+
+    // should be called under m_access
+    void startScheduled()
+    {
+        while (const auto id = m_scheduler.next())
+        {
+            const auto blocking = m_blocking.find(*id);
+            if (blocking != end(m_blocking))
+            {
+                // waiting thread does the work
+                blocking->second = true;
+                m_slotGranted.notify_all();
+                continue;
+            }
+            LoadQueues::instance().io().post([this, id = *id, path = m_scheduled[*id]]
+            {
+                auto bytes = std::make_shared<std::string>();
+                const auto started = LoadScheduler::Clock::now();
+                const auto read = readHoldingSlot(path, *bytes);
+                {
+                    // disk is free for next one while this is deserialized
+                    std::scoped_lock<std::mutex> guard {m_access};
+                    traceRead(path, started);
+                    m_scheduler.release(id);
+                    startScheduled();
+                }
+                if (!read)
+                {
+                    finishAsync(id, path, {});
+                    return;
+                }
+                LoadQueues::instance().cpu().post([this, id, path, bytes]
+                {
+                    TypeUniquePtr unique;
+                    try
+                    {
+                        unique = std::make_unique<ValueType>();
+                        if (!doDeserialize(path, *bytes, *unique))
+                        {
+                            unique = nullptr;
+                        }
+                    }
+                    catch (const std::exception& e)
+                    {
+                        std::cout << "ERROR: cannot read file! " << path << " " << e.what() << "\n";
+                        unique = nullptr;
+                    }
+                    finishAsync(id, path, std::move(unique));
+                });
+            });
+        }
+    }
+
+    void finishAsync(LoadScheduler::Id id, const std::string& path, TypeUniquePtr unique)
+    {
+        std::vector<LoadCallback> waiting;
+        TypeSharedPtr shared;
+        auto missed = size_t {0};
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            missed = m_scheduler.complete(id, LoadScheduler::Clock::now());
+            m_scheduled.erase(id);
+            const auto pending = m_pending.find(path);
+            waiting = std::move(pending->second.waiting);
+            if (unique)
+            {
+                shared = putToCache(path, std::move(unique));
+#if RESMGR_TRACKING
+                auto& tracking = m_cache[path].tracking;
+                for (auto& sample : pending->second.samples)
+                {
+                    tracking.acquired(std::move(sample));
+                }
+#endif
+            }
+            m_pending.erase(pending);
+        }
+        if (missed)
+        {
+            std::cout << "WARNING: Resource " << path << " missed deadline of " << missed << " requests!\n";
+        }
+        for (auto& done : waiting)
+        {
+            done(shared);
+        }
+    }
+
+    TypeSharedPtr reloadInternal(const std::string& path)
+    {
+        if (!hasValidExtension(path))
+        {
+            return {};
+        }
+
+        std::shared_ptr<ResourceSignals> signals;
+        TypeSharedPtr previous;
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            const auto cached = m_cache.find(path);
+            if (cached != end(m_cache))
+            {
+                previous = cached->second.resource.lock();
+                signals = cached->second.signals;
+            }
+        }
+        if (!previous)
+        {
+            // nobody holds it, nothing to version
+            return loadInternal(path);
+        }
 
-            // steal to shared and put into cache
-            auto shared = TypeSharedPtr(unique.release(), destroyData);
-            auto res = Resource{};
-            res.resource = TypeWeakPtr {shared};
-            m_cache[path] = std::move(res);
-            return shared; // RNVO should handle moving named shared_ptr
+        signals->requestReload();
+        auto unique = std::make_unique<ValueType>();
+        if (!loadBlocking(path, *unique))
+        {
+            // users stay on previous version
+            signals->reloadDone();
+            return {};
         }
+
+        TypeSharedPtr shared;
+        {
+            std::scoped_lock<std::mutex> guard {m_access};
+            // entry could be saved over meanwhile, it keeps signals then and we publish over it
+            auto& entry = m_cache[path];
+            shared = share(path, std::move(unique), entry);
+#if RESMGR_TRACKING
+            entry.tracking.loaded = std::chrono::steady_clock::now();
+            entry.tracking.acquired();
+#endif
+        }
+        signals->reloadDone();
+        return shared;
     }
 
     bool saveInternal(const std::string& path, TypeSharedPtr data)
@@ -203,13 +1097,59 @@ private:
         std::scoped_lock<std::mutex> guard {m_access};
         // we need somehow notify users about resource changing
         // or else they will crash out application
-        auto res = Resource{};
-        res.resource = TypeWeakPtr {data};
-        m_cache[path] = std::move(res);
+        // entry is updated in place: users stay connected and reload in flight keeps its signals
+        auto& entry = m_cache[path];
+        entry.resource = TypeWeakPtr {data};
+        // not created by us, so no deleter of ours would ever match it
+        entry.version = ++m_lastVersion;
         return true;
     }
 
+    // should be called under m_access
+    // Acquisition is tracked by caller, it knows on which thread resource was requested
+    TypeSharedPtr putToCache(const std::string& path, TypeUniquePtr unique)
+    {
+        // try to find again, somebody could load it meanwhile
+        auto cached = findInCache(path);
+        if (cached)
+            return cached;
+
+        // steal to shared and put into cache
+        auto& entry = m_cache[path];
+        auto shared = share(path, std::move(unique), entry);
+        return shared; // RNVO should handle moving named shared_ptr
+    }
+
+    // should be called under m_access
+    TypeSharedPtr share(const std::string& path, TypeUniquePtr unique, Resource& entry)
+    {
+        const auto version = ++m_lastVersion;
+        auto shared = TypeSharedPtr(unique.release(), [path, version](ValueType* raw)
+        {
+            destroyData(path, version, raw);
+        });
+        entry.resource = TypeWeakPtr {shared};
+        entry.version = version;
+#if RESMGR_TRACKING
+        m_versions[version] = TrackedVersion {path, entry.resource, std::chrono::steady_clock::now()};
+#endif
+        return shared;
+    }
+
     TypeSharedPtr getFromCache(const std::string& resource)
+    {
+        auto cached = findInCache(resource);
+#if RESMGR_TRACKING
+        if (cached)
+        {
+            m_cache[resource].tracking.acquired();
+        }
+#endif
+        return cached;
+    }
+
+    // should be called under m_access
+    TypeSharedPtr findInCache(const std::string& resource)
     {
         const auto cached = m_cache.find(resource);
         if (cached != end(m_cache))
@@ -226,46 +1166,84 @@ private:
         return {};
     }
 
-    static void destroyData(ValueType* raw)
+    static void destroyData(const std::string& path, uint64_t version, ValueType* raw)
     {
         auto& manager = Factory::instance();
-        std::lock_guard<std::mutex> guard {manager.m_access};
-        // first expired is our destroyed pointer
-        // we could check if we can get internal control block of weak
-        // but its too hackerish so no
-        const auto expired = std::find_if(begin(manager.m_cache), end(manager.m_cache), [](auto& p)
-        {
-            return p.second.resource.expired();
-        });
-        if (expired == end(manager.m_cache))
         {
-            // THIS IS BAD!
-            // We shouldn't get destroyed by shared_ptr decref
-            // and could not find any expired weak!
-            return;
+            std::lock_guard<std::mutex> guard {manager.m_access};
+            const auto cached = manager.m_cache.find(path);
+            if (cached != end(manager.m_cache) && cached->second.version == version)
+            {
+                manager.m_cache.erase(cached);
+            }
+            else
+            {
+                // Entry already points to newer version after reload or save,
+                // or it was found expired and erased before we got the lock.
+            }
+#if RESMGR_TRACKING
+            if (manager.m_versions.erase(version) == 0)
+            {
+                // every version we hand out is recorded, so bookkeeping is broken
+                ++manager.m_unmatchedReleases;
+                std::cout << "ERROR: released resource " << path << " was never tracked!\n";
+            }
+#endif
         }
-        manager.m_cache.erase(expired);
+        // out of lock, destructor is free to use factory
+        delete raw;
     }
 
 private:
     CacheType m_cache;
+    struct PendingLoad
+    {
+        LoadScheduler::Id id = 0;
+        std::vector<LoadCallback> waiting;
+#if RESMGR_TRACKING
+        // of every waiting request, taken on requesting thread
+        std::vector<AcquisitionSample> samples;
+#endif
+    };
+
+    // async loads queued or in flight
+    std::unordered_map<ResourcePathType, PendingLoad> m_pending;
+    uint64_t m_lastVersion = 0;
+    std::unordered_map<LoadScheduler::Id, ResourcePathType> m_scheduled;
+    // blocking loads, true when slot is granted
+    std::unordered_map<LoadScheduler::Id, bool> m_blocking;
+    std::condition_variable m_slotGranted;
+    LoadScheduler m_scheduler {LoadQueues::DEFAULT_IO_THREADS};
+    std::ostream* m_trace = nullptr;
+    LoadScheduler::Clock::time_point m_traceStart;
+#if RESMGR_TRACKING
+    struct TrackedVersion
+    {
+        ResourcePathType path;
+        TypeWeakPtr resource;
+        std::chrono::steady_clock::time_point loaded;
+    };
+
+    // every version handed out and not yet released, superseded ones included
+    std::unordered_map<uint64_t, TrackedVersion> m_versions;
+    // released versions missing from m_versions
+    uint64_t m_unmatchedReleases = 0;
+#endif
     std::mutex m_access;
 };
 
-template <typename T>
-class FstreamFactory : public Factory<FstreamFactory<T>, T>
+// Factory for resources stored in files, accepts only listed extensions
+template <typename Implementation, typename T>
+class FileFactory : public Factory<Implementation, T>
 {
-    friend class Singleton<FstreamFactory>;
-
 protected:
-    FstreamFactory()
-        : Factory<FstreamFactory, T>() {}
+    FileFactory()
+        : Factory<Implementation, T>() {}
 
-    explicit FstreamFactory(std::vector<std::string> extensions)
-        : Factory<FstreamFactory, T>()
+    explicit FileFactory(std::vector<std::string> extensions)
+        : Factory<Implementation, T>()
         , m_supportedExtensions(std::move(extensions)) { }
 
-
     bool hasValidExtension(std::string_view resource) override
     {
         const auto extension = std::filesystem::path(resource).extension().string();
@@ -273,6 +1251,22 @@ protected:
             m_supportedExtensions);
     }
 
+private:
+    std::vector<std::string> m_supportedExtensions;
+};
+
+template <typename T>
+class FstreamFactory : public FileFactory<FstreamFactory<T>, T>
+{
+    friend class Singleton<FstreamFactory>;
+
+protected:
+    FstreamFactory()
+        : FileFactory<FstreamFactory, T>() {}
+
+    explicit FstreamFactory(std::vector<std::string> extensions)
+        : FileFactory<FstreamFactory, T>(std::move(extensions)) { }
+
     bool doLoad(std::string_view resource, typename FstreamFactory::ValueType& data) override
     {
         const auto resourcepath = std::string {resource};
@@ -282,11 +1276,39 @@ protected:
             std::cout << "ERROR: cannot open file!" << resourcepath;
             return false;
         }
-        boost::archive::binary_iarchive ar {file};
-        ar >> data;
+        // archive reads straight from file, nothing is buffered twice
+        return deserialize(resource, *file.rdbuf(), data);
+    }
+
+    bool doRead(std::string_view resource, std::string& bytes) override
+    {
+        const auto resourcepath = std::string {resource};
+        auto file = std::ifstream {resourcepath, std::ifstream::binary | std::ifstream::ate};
+        if (!file.is_open())
+        {
+            std::cout << "ERROR: cannot open file!" << resourcepath;
+            return false;
+        }
+        bytes.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(bytes.data(), bytes.size());
+        if (!file)
+        {
+            std::cout << "ERROR: cannot read file! " << resourcepath << "\n";
+            return false;
+        }
         return true;
     }
 
+    bool doDeserialize(
+        std::string_view resource,
+        const std::string& bytes,
+        typename FstreamFactory::ValueType& data) override
+    {
+        auto buffer = MemoryStreambuf {bytes.data(), bytes.size()};
+        return deserialize(resource, buffer, data);
+    }
+
     bool doSave(std::string_view resource, typename FstreamFactory::ValueType& data) override
     {
         const auto resourcepath = std::string {resource};
@@ -302,5 +1324,77 @@ protected:
     }
 
 private:
-    std::vector<std::string> m_supportedExtensions;
+    bool deserialize(std::string_view resource, std::streambuf& source, typename FstreamFactory::ValueType& data)
+    {
+        try
+        {
+            boost::archive::binary_iarchive ar {source};
+            ar >> data;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "ERROR: cannot read file! " << resource << " " << e.what() << "\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Loads only table of contents, objects are read on first access.
+// T should provide loadLazy(path, T&) and saveLazy(path, const T&), and for split loads
+// readLazyTableOfContents(path, std::string&, const T*) with loadLazyTableOfContents(path, const std::string&, T&),
+// all found by argument dependent lookup
+template <typename T>
+class LazyFstreamFactory : public FileFactory<LazyFstreamFactory<T>, T>
+{
+    friend class Singleton<LazyFstreamFactory>;
+
+protected:
+    LazyFstreamFactory()
+        : FileFactory<LazyFstreamFactory, T>() {}
+
+    explicit LazyFstreamFactory(std::vector<std::string> extensions)
+        : FileFactory<LazyFstreamFactory, T>(std::move(extensions)) { }
+
+    bool doLoad(std::string_view resource, typename LazyFstreamFactory::ValueType& data) override
+    {
+        try
+        {
+            return loadLazy(std::string {resource}, data);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "ERROR: cannot read file! " << resource << " " << e.what() << "\n";
+            return false;
+        }
+    }
+
+    // only table of contents is read under io slot, bodies are read later by whoever uses them
+    bool doRead(std::string_view resource, std::string& bytes) override
+    {
+        // pointer only selects function for T
+        return readLazyTableOfContents(
+            std::string {resource}, bytes, static_cast<const typename LazyFstreamFactory::ValueType*>(nullptr));
+    }
+
+    bool doDeserialize(
+        std::string_view resource,
+        const std::string& bytes,
+        typename LazyFstreamFactory::ValueType& data) override
+    {
+        try
+        {
+            return loadLazyTableOfContents(std::string {resource}, bytes, data);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "ERROR: cannot read file! " << resource << " " << e.what() << "\n";
+            return false;
+        }
+    }
+
+    bool doSave(std::string_view resource, typename LazyFstreamFactory::ValueType& data) override
+    {
+        return saveLazy(std::string {resource}, data);
+    }
 };
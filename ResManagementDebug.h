@@ -0,0 +1,260 @@
+#pragma once
+
+// Define RESMGR_TRACKING to 1 to track acquisitions of every Factory resource.
+// When not defined nothing below adds a byte or an instruction to Factory itself,
+// DebugInterface reports still work but only with path, refcount and size.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if RESMGR_TRACKING
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <execinfo.h>
+#endif
+#endif
+
+#ifndef RESMGR_TRACKING_SAMPLE_RATE
+// every n-th acquisition captures stack, first one always does
+#define RESMGR_TRACKING_SAMPLE_RATE 16
+#endif
+
+//---------------------------------------------------------------------------------------------------------------------
+// Resource size
+//---------------------------------------------------------------------------------------------------------------------
+// Resource may provide resourceSize(const T&) found by ADL, otherwise only sizeof is counted
+namespace resmgr_detail
+{
+template <typename T>
+auto resourceSizeImpl(const T& value, int) -> decltype(size_t {resourceSize(value)})
+{
+    return resourceSize(value);
+}
+
+template <typename T>
+size_t resourceSizeImpl(const T&, long)
+{
+    return sizeof(T);
+}
+}
+
+template <typename T>
+size_t sizeOfResource(const T& value)
+{
+    return resmgr_detail::resourceSizeImpl(value, 0);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Tracking
+//---------------------------------------------------------------------------------------------------------------------
+struct AcquisitionSample
+{
+    static constexpr size_t MAX_DEPTH = 16;
+
+    std::chrono::steady_clock::time_point time;
+    std::vector<void*> frames;
+};
+
+#if RESMGR_TRACKING
+struct ResourceTracking
+{
+    static constexpr size_t MAX_SAMPLES = 8;
+
+    std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+    uint64_t acquisitions = 0;
+    // newest replace oldest when full
+    std::vector<AcquisitionSample> samples;
+
+    // stack of calling thread, skip is number of frames above caller to leave out
+    static AcquisitionSample capture(unsigned skip = 0)
+    {
+        auto sample = AcquisitionSample {};
+        sample.time = std::chrono::steady_clock::now();
+        // skip this frame too
+#if defined(_WIN32)
+        sample.frames.resize(AcquisitionSample::MAX_DEPTH);
+        const auto depth = CaptureStackBackTrace(
+            1 + skip, static_cast<DWORD>(sample.frames.size()), sample.frames.data(), nullptr);
+        sample.frames.resize(static_cast<size_t>(depth));
+#else
+        sample.frames.resize(AcquisitionSample::MAX_DEPTH + 1 + skip);
+        const auto depth = backtrace(sample.frames.data(), static_cast<int>(sample.frames.size()));
+        sample.frames.resize(static_cast<size_t>(depth));
+        sample.frames.erase(begin(sample.frames), begin(sample.frames) + std::min<size_t>(1 + skip, depth));
+#endif
+        return sample;
+    }
+
+    void acquired()
+    {
+        if (acquisitions % RESMGR_TRACKING_SAMPLE_RATE != 0)
+        {
+            ++acquisitions;
+            return;
+        }
+        acquired(capture(1));
+    }
+
+    // For acquisition completed on other thread than it was requested from, e.g. async load.
+    // Sample is captured by requesting thread and kept when this acquisition is sampled
+    void acquired(AcquisitionSample sample)
+    {
+        const auto count = acquisitions++;
+        if (count % RESMGR_TRACKING_SAMPLE_RATE != 0)
+            return;
+        const auto slot = (count / RESMGR_TRACKING_SAMPLE_RATE) % MAX_SAMPLES;
+        if (slot < samples.size())
+            samples[slot] = std::move(sample);
+        else
+            samples.push_back(std::move(sample));
+    }
+};
+#endif
+
+//---------------------------------------------------------------------------------------------------------------------
+// Reports
+//---------------------------------------------------------------------------------------------------------------------
+struct LiveResource
+{
+    std::string path;
+    long references = 0; // not counting report itself
+    size_t bytes = 0;
+#if RESMGR_TRACKING
+    std::chrono::steady_clock::duration age {};
+    uint64_t acquisitions = 0;
+    std::vector<AcquisitionSample> samples;
+    // replaced in cache by reload or save, still held by somebody
+    bool superseded = false;
+#endif
+};
+
+class DebugInterface
+{
+public:
+    // Snapshot of resources still held by somebody, safe to call from any thread.
+    // With tracking superseded versions are reported too
+    template <typename FactoryType>
+    static std::vector<LiveResource> liveResources()
+    {
+        auto& manager = FactoryType::instance();
+        auto live = std::vector<LiveResource> {};
+        // pinned outside of lock, last release would call destroyData that locks too
+        auto pinned = std::vector<typename FactoryType::TypeSharedPtr> {};
+        {
+            std::scoped_lock<std::mutex> guard {manager.m_access};
+            for (auto& kv : manager.m_cache)
+            {
+                auto shared = kv.second.resource.lock();
+                if (!shared)
+                    continue;
+                auto resource = LiveResource {};
+                resource.path = kv.first;
+                resource.references = shared.use_count() - 1;
+#if RESMGR_TRACKING
+                const auto& tracking = kv.second.tracking;
+                resource.age = std::chrono::steady_clock::now() - tracking.loaded;
+                resource.acquisitions = tracking.acquisitions;
+                resource.samples = tracking.samples;
+#endif
+                live.push_back(std::move(resource));
+                pinned.push_back(std::move(shared));
+            }
+#if RESMGR_TRACKING
+            for (auto& kv : manager.m_versions)
+            {
+                const auto cached = manager.m_cache.find(kv.second.path);
+                if (cached != end(manager.m_cache) && cached->second.version == kv.first)
+                    continue;
+                auto shared = kv.second.resource.lock();
+                if (!shared)
+                    continue;
+                auto resource = LiveResource {};
+                resource.path = kv.second.path;
+                resource.references = shared.use_count() - 1;
+                resource.age = std::chrono::steady_clock::now() - kv.second.loaded;
+                resource.superseded = true;
+                live.push_back(std::move(resource));
+                pinned.push_back(std::move(shared));
+            }
+#endif
+        }
+        for (auto i = size_t {0}; i < live.size(); ++i)
+        {
+            live[i].bytes = sizeOfResource(*pinned[i]);
+        }
+        return live;
+    }
+
+    template <typename FactoryType>
+    static void dump(std::ostream& out)
+    {
+        const auto live = liveResources<FactoryType>();
+        auto total = size_t {0};
+        for (auto& resource : live)
+        {
+            total += resource.bytes;
+        }
+        out << "Live resources: " << live.size() << ", " << total << " bytes\n";
+        for (auto& resource : live)
+        {
+            out << " " << resource.path << ": " << resource.bytes << " bytes, " << resource.references << " refs";
+#if RESMGR_TRACKING
+            const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(resource.age);
+            out << ", age " << age.count() << " ms, " << resource.acquisitions << " acquisitions";
+            if (resource.superseded)
+            {
+                out << ", superseded";
+            }
+#endif
+            out << "\n";
+#if RESMGR_TRACKING
+            dumpSamples(out, resource.samples);
+#endif
+        }
+#if RESMGR_TRACKING
+        auto& manager = FactoryType::instance();
+        std::scoped_lock<std::mutex> guard {manager.m_access};
+        if (manager.m_unmatchedReleases)
+        {
+            out << " Released but never tracked: " << manager.m_unmatchedReleases << "\n";
+        }
+#endif
+    }
+
+#if RESMGR_TRACKING
+    static void dumpSamples(std::ostream& out, const std::vector<AcquisitionSample>& samples)
+    {
+        for (auto& sample : samples)
+        {
+            const auto ago = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - sample.time);
+            out << "  acquired " << ago.count() << " ms ago at:\n";
+#if defined(_WIN32)
+            // symbolize offline, addresses are enough here
+            for (auto frame : sample.frames)
+            {
+                out << "   " << frame << "\n";
+            }
+#else
+            const auto symbols = std::unique_ptr<char*, void (*)(void*)>(
+                backtrace_symbols(sample.frames.data(), static_cast<int>(sample.frames.size())), std::free);
+            for (auto i = size_t {0}; i < sample.frames.size(); ++i)
+            {
+                out << "   " << (symbols ? symbols.get()[i] : "?") << "\n";
+            }
+#endif
+        }
+    }
+#endif
+};
@@ -1,2 +1,335 @@
 #include "stdafx.h"
 #include "TestData.h"
+
+#include <boost/serialization/extended_type_info_typeid.hpp>
+#include <boost/serialization/void_cast.hpp>
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+namespace
+{
+const boost::serialization::extended_type_info_typeid<ObjectData>& objectDataTypeInfo()
+{
+    return boost::serialization::singleton<
+        boost::serialization::extended_type_info_typeid<ObjectData>>::get_const_instance();
+}
+
+// same registry boost uses for polymorphic pointers, so any exported ObjectData works here
+std::unique_ptr<ObjectData> createObject(const std::string& type)
+{
+    const auto derived = boost::serialization::extended_type_info::find(type.c_str());
+    if (!derived)
+    {
+        return {};
+    }
+    const auto raw = derived->construct();
+    const auto base = boost::serialization::void_upcast(*derived, objectDataTypeInfo(), raw);
+    if (!base)
+    {
+        derived->destroy(raw);
+        return {};
+    }
+    return std::unique_ptr<ObjectData>(static_cast<ObjectData*>(const_cast<void*>(base)));
+}
+
+// Lazy files by path. One lock for all files: it is held only while file is opened
+// with its table of contents read, or written
+struct LazyFile
+{
+    uint64_t saves = 0; // tells whether table of contents read earlier is still what is in file
+    std::vector<std::weak_ptr<LazySource>> sources;
+};
+
+struct LazyFiles
+{
+    std::mutex access;
+    std::unordered_map<std::string, LazyFile> files;
+};
+
+LazyFiles& lazyFiles()
+{
+    static auto files = LazyFiles {};
+    return files;
+}
+
+std::string lazyFileKey(const std::string& path)
+{
+    auto error = std::error_code {};
+    const auto canonical = std::filesystem::weakly_canonical(path, error);
+    if (!error)
+    {
+        return canonical.string();
+    }
+    return std::filesystem::absolute(path, error).lexically_normal().string();
+}
+
+uint64_t lazyFileSaves(LazyFiles& files, const std::string& path)
+{
+    const auto file = files.files.find(lazyFileKey(path));
+    return file != end(files.files) ? file->second.saves : 0;
+}
+
+// Table of contents goes right after its size, should be called under files lock
+bool readTableOfContents(const std::string& path, std::ifstream& file, std::string& tableOfContents)
+{
+    auto size = uint64_t {0};
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    const auto start = file.tellg();
+    file.seekg(0, std::ifstream::end);
+    const auto fileSize = static_cast<uint64_t>(file.tellg());
+    if (!file || size > fileSize - sizeof(size))
+    {
+        std::cout << "ERROR: cannot read file! " << path << "\n";
+        return false;
+    }
+    tableOfContents.resize(static_cast<size_t>(size));
+    file.seekg(start);
+    file.read(tableOfContents.data(), tableOfContents.size());
+    if (!file)
+    {
+        std::cout << "ERROR: cannot read file! " << path << "\n";
+        return false;
+    }
+    return true;
+}
+}
+
+size_t resourceSize(const Data& data)
+{
+    auto bytes = sizeof(Data) + data.objects.capacity() * sizeof(data.objects.front());
+    for (auto& object : data.objects)
+    {
+        bytes += object->residentSize();
+    }
+    return bytes;
+}
+
+uint32_t payloadDigest(const Data& data)
+{
+    const auto& kernel = payloadKernel();
+    auto digest = uint32_t {0};
+    for (auto& object : data.objects)
+    {
+        if (const auto model = boost::typeindex::runtime_cast<const ModelObjectData*>(object.get()))
+        {
+            const auto& payload = model->payload();
+            digest = kernel.crc32c(payload.data(), payload.size(), digest);
+        }
+    }
+    return digest;
+}
+
+uint32_t processPayloads(Data& data, PayloadTransform transform)
+{
+    const auto& kernel = payloadKernel();
+    auto digest = uint32_t {0};
+    for (auto& object : data.objects)
+    {
+        if (const auto model = boost::typeindex::runtime_cast<ModelObjectData*>(object.get()))
+        {
+            auto& payload = model->mutablePayload();
+            // payload is hot in cache after checksum, transform goes right away
+            digest = kernel.crc32c(payload.data(), payload.size(), digest);
+            if (transform == PayloadTransform::ByteSwap32)
+            {
+                kernel.byteSwap32(payload.data(), payload.size());
+            }
+        }
+    }
+    return digest;
+}
+
+bool saveLazy(const std::string& path, const Data& data)
+{
+    auto types = std::vector<std::string> {};
+    auto headers = std::vector<ObjectHeader> {};
+    headers.reserve(data.objects.size());
+    auto bodies = std::ostringstream {};
+    for (auto& object : data.objects)
+    {
+        const auto key = objectDataTypeInfo().get_derived_extended_type_info(*object)->get_key();
+        if (!key)
+        {
+            std::cout << "ERROR: object type is not exported! " << object->name;
+            return false;
+        }
+        auto header = ObjectHeader {};
+        const auto type = std::find(begin(types), end(types), key);
+        header.type = static_cast<uint32_t>(type - begin(types));
+        if (type == end(types))
+        {
+            types.emplace_back(key);
+        }
+        header.name = object->name;
+        header.offset = static_cast<uint64_t>(bodies.tellp());
+        auto body = std::ostringstream {};
+        {
+            object->materialize();
+            boost::archive::binary_oarchive ar {body, boost::archive::no_header};
+            object->saveBody(ar);
+        }
+        const auto bytes = body.str();
+        header.size = bytes.size();
+        header.digest = payloadKernel().crc32c(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size(), 0);
+        bodies << bytes;
+        headers.push_back(std::move(header));
+    }
+    auto contents = std::ostringstream {};
+    {
+        boost::archive::binary_oarchive ar {contents};
+        ar << data.duration;
+        ar << types;
+        ar << headers;
+    }
+    const auto tableOfContents = contents.str();
+    const auto size = static_cast<uint64_t>(tableOfContents.size());
+
+    // objects still reading from this file take their bodies to memory, before file is truncated
+    auto& files = lazyFiles();
+    std::scoped_lock<std::mutex> guard {files.access};
+    auto& lazyFile = files.files[lazyFileKey(path)];
+    for (auto& weak : lazyFile.sources)
+    {
+        if (const auto source = weak.lock())
+        {
+            source->detach();
+        }
+    }
+    lazyFile.sources.clear();
+    ++lazyFile.saves;
+
+    auto file = std::fstream {path, std::fstream::out | std::fstream::binary};
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: cannot open file!" << path;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file << tableOfContents;
+    file << bodies.str();
+    return true;
+}
+
+bool readLazyTableOfContents(const std::string& path, std::string& contents, const Data*)
+{
+    // file is not written while its table of contents is read
+    auto& files = lazyFiles();
+    std::scoped_lock<std::mutex> guard {files.access};
+    auto file = std::ifstream {path, std::ifstream::binary};
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: cannot open file!" << path;
+        return false;
+    }
+    const auto saves = lazyFileSaves(files, path);
+    auto tableOfContents = std::string {};
+    if (!readTableOfContents(path, file, tableOfContents))
+    {
+        return false;
+    }
+    contents.assign(reinterpret_cast<const char*>(&saves), sizeof(saves));
+    contents += tableOfContents;
+    return true;
+}
+
+bool loadLazyTableOfContents(const std::string& path, const std::string& contents, Data& data)
+{
+    auto saves = uint64_t {0};
+    if (contents.size() < sizeof(saves))
+    {
+        std::cout << "ERROR: cannot read file! " << path << "\n";
+        return false;
+    }
+    std::memcpy(&saves, contents.data(), sizeof(saves));
+    auto tableOfContents = contents.substr(sizeof(saves));
+
+    // bodies are opened under same lock, so they are of the same save as table of contents
+    auto bodiesOffset = uint64_t {0};
+    auto bodiesSize = uint64_t {0};
+    auto source = std::shared_ptr<LazySource> {};
+    {
+        auto& files = lazyFiles();
+        std::scoped_lock<std::mutex> guard {files.access};
+        auto file = std::ifstream {path, std::ifstream::binary};
+        if (!file.is_open())
+        {
+            std::cout << "ERROR: cannot open file!" << path;
+            return false;
+        }
+        if (lazyFileSaves(files, path) != saves && !readTableOfContents(path, file, tableOfContents))
+        {
+            // saved over after contents were read
+            return false;
+        }
+        bodiesOffset = sizeof(uint64_t) + tableOfContents.size();
+        file.seekg(0, std::ifstream::end);
+        const auto fileSize = static_cast<uint64_t>(file.tellg());
+        if (!file || fileSize < bodiesOffset)
+        {
+            std::cout << "ERROR: cannot read file! " << path << "\n";
+            return false;
+        }
+        bodiesSize = fileSize - bodiesOffset;
+        source = std::make_shared<LazySource>(std::move(file), bodiesOffset, bodiesSize);
+        auto& registered = files.files[lazyFileKey(path)].sources;
+        registered.erase(std::remove_if(begin(registered), end(registered),
+            [](const std::weak_ptr<LazySource>& weak) { return weak.expired(); }), end(registered));
+        registered.push_back(source);
+    }
+
+    auto types = std::vector<std::string> {};
+    auto headers = std::vector<ObjectHeader> {};
+    try
+    {
+        auto stream = std::istringstream {tableOfContents};
+        boost::archive::binary_iarchive ar {stream};
+        ar >> data.duration;
+        ar >> types;
+        ar >> headers;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "ERROR: cannot read file! " << path << " " << e.what() << "\n";
+        return false;
+    }
+    // bodies are read much later, broken entry should fail load and not first access
+    for (auto& header : headers)
+    {
+        if (header.offset > bodiesSize || header.size > bodiesSize - header.offset)
+        {
+            std::cout << "ERROR: object is out of file! " << header.name << "\n";
+            return false;
+        }
+    }
+
+    data.objects.clear();
+    data.objects.reserve(headers.size());
+    for (auto& header : headers)
+    {
+        auto object = header.type < types.size() ? createObject(types[header.type]) : nullptr;
+        if (!object)
+        {
+            std::cout << "ERROR: unknown object type! " << header.name;
+            return false;
+        }
+        object->name = std::move(header.name);
+        object->dropBody();
+        object->lazyBody = std::make_unique<LazyBody>();
+        object->lazyBody->source = source;
+        object->lazyBody->offset = header.offset;
+        object->lazyBody->size = header.size;
+        object->lazyBody->digest = header.digest;
+        data.objects.push_back(std::move(object));
+    }
+    return true;
+}
+
+bool loadLazy(const std::string& path, Data& data)
+{
+    auto contents = std::string {};
+    return readLazyTableOfContents(path, contents) && loadLazyTableOfContents(path, contents, data);
+}
@@ -5,13 +5,109 @@
 #include <boost/serialization/array.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/export.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/split_free.hpp>
+#include <boost/serialization/version.hpp>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
 
 #include <boost/type_index.hpp>
 #include <boost/type_index/runtime_cast.hpp>
 
+#include "PayloadProcessing.h"
+
 #include <memory>
 #include <array>
 #include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <stdexcept>
+
+//---------------------------------------------------------------------------------------------------------------------
+// Lazy loading support
+//---------------------------------------------------------------------------------------------------------------------
+// Table of contents entry, everything we know about object before its body is read
+struct ObjectHeader
+{
+    uint32_t type = 0; // index in types table of Data, see saveLazy
+    std::string name;
+    uint64_t offset = 0; // from the start of bodies section
+    uint64_t size = 0;
+    uint32_t digest = 0; // CRC32C of body bytes
+};
+
+// File with object bodies, shared by all not yet materialized objects of one Data.
+// Before file is saved over, bodies are copied to memory, see detach
+class LazySource
+{
+public:
+    LazySource(std::ifstream file, uint64_t bodiesOffset, uint64_t bodiesSize)
+        : m_file(std::move(file))
+        , m_bodiesOffset(bodiesOffset)
+        , m_bodiesSize(bodiesSize) { }
+
+    // range should be checked against bodies size already, see loadLazyTableOfContents
+    std::string read(uint64_t offset, uint64_t size)
+    {
+        std::scoped_lock<std::mutex> guard {m_access};
+        if (!m_file.is_open())
+        {
+            if (offset > m_detached.size() || size > m_detached.size() - offset)
+            {
+                throw std::runtime_error("lazy object body is truncated");
+            }
+            return m_detached.substr(offset, size);
+        }
+        auto bytes = std::string(size, '\0');
+        m_file.clear();
+        m_file.seekg(m_bodiesOffset + offset);
+        m_file.read(bytes.data(), size);
+        if (!m_file || static_cast<uint64_t>(m_file.gcount()) != size)
+        {
+            // file changed under us
+            throw std::runtime_error("lazy object body is truncated");
+        }
+        return bytes;
+    }
+
+    // Copies all bodies to memory and closes file, later reads do not depend on what is in file.
+    // Whatever could not be read fails on read, same as broken file would
+    void detach()
+    {
+        std::scoped_lock<std::mutex> guard {m_access};
+        if (!m_file.is_open())
+            return;
+        m_detached.resize(m_bodiesSize);
+        m_file.clear();
+        m_file.seekg(m_bodiesOffset);
+        m_file.read(m_detached.data(), m_bodiesSize);
+        m_detached.resize(static_cast<size_t>(m_file ? m_bodiesSize : m_file.gcount()));
+        m_file.close();
+    }
+
+private:
+    std::ifstream m_file;
+    uint64_t m_bodiesOffset;
+    uint64_t m_bodiesSize;
+    std::string m_detached;
+    std::mutex m_access;
+};
+
+// Kept apart from object, so objects which were never lazy pay only for pointer
+struct LazyBody
+{
+    std::shared_ptr<LazySource> source; // released once body is read
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t digest = 0;
+    std::once_flag materialized;
+    std::atomic<bool> loaded {false};
+};
 
 //---------------------------------------------------------------------------------------------------------------------
 // Static Data
@@ -20,16 +116,136 @@ struct ObjectData
 {
     BOOST_TYPE_INDEX_REGISTER_RUNTIME_CLASS(BOOST_TYPE_INDEX_NO_BASE_CLASS)
 
+    ObjectData() = default;
+
+    // copy of lazy object is always materialized, we do not want two objects to share one body
+    ObjectData(const ObjectData& other)
+        : name((other.materialize(), other.name)) { }
+
+    ObjectData& operator=(const ObjectData& other)
+    {
+        if (this == &other)
+            return *this;
+        other.materialize();
+        materialize();
+        name = other.name;
+        return *this;
+    }
+
     virtual ~ObjectData() { }
 
+    // reads body of lazy loaded object, safe to call from any thread and any number of times.
+    // Throws when body could not be read, next call tries again
+    void materialize() const
+    {
+        if (!lazyBody)
+            return;
+        std::call_once(lazyBody->materialized, [this]
+        {
+            const auto bytes = lazyBody->source->read(lazyBody->offset, lazyBody->size);
+            const auto digest = payloadKernel().crc32c(
+                reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size(), 0);
+            if (digest != lazyBody->digest)
+            {
+                throw std::runtime_error("lazy object body digest mismatch");
+            }
+            auto stream = std::istringstream {bytes};
+            boost::archive::binary_iarchive ar {stream, boost::archive::no_header};
+            const_cast<ObjectData*>(this)->loadBody(ar);
+            // file is closed when last object of it is read
+            lazyBody->source.reset();
+            lazyBody->loaded.store(true, std::memory_order_release);
+        });
+    }
+
+    // false only for lazy object whose body was not read yet
+    bool isMaterialized() const
+    {
+        return !lazyBody || lazyBody->loaded.load(std::memory_order_acquire);
+    }
+
+    // body is everything except header (name and type)
+    virtual void saveBody(boost::archive::binary_oarchive& ar) const { }
+
+    virtual void loadBody(boost::archive::binary_iarchive& ar) { }
+
+    // frees body storage of object created from table of contents, loadBody allocates it again
+    virtual void dropBody() { }
+
+    // memory held by object, body storage is counted only when it is there
+    virtual size_t residentSize() const
+    {
+        return sizeof(ObjectData) + name.capacity() + (lazyBody ? sizeof(LazyBody) : 0);
+    }
+
     std::string name;
+
+    // set only for objects created from table of contents
+    mutable std::unique_ptr<LazyBody> lazyBody;
 };
 
 struct ModelObjectData : ObjectData
 {
     BOOST_TYPE_INDEX_REGISTER_RUNTIME_CLASS((ObjectData))
 
-    std::array<unsigned char, 120> modelPayload;
+    using Payload = std::array<unsigned char, 120>;
+
+    ModelObjectData()
+        : modelPayload(std::make_unique<Payload>()) { }
+
+    ModelObjectData(const ModelObjectData& other)
+        : ObjectData(other)
+        , modelPayload(std::make_unique<Payload>(other.payload())) { }
+
+    ModelObjectData& operator=(const ModelObjectData& other)
+    {
+        if (this == &other)
+            return *this;
+        ObjectData::operator=(other);
+        *modelPayload = other.payload();
+        return *this;
+    }
+
+    const Payload& payload() const
+    {
+        materialize();
+        return *modelPayload;
+    }
+
+    Payload& mutablePayload()
+    {
+        materialize();
+        return *modelPayload;
+    }
+
+    void saveBody(boost::archive::binary_oarchive& ar) const override
+    {
+        ar << *modelPayload;
+    }
+
+    void loadBody(boost::archive::binary_iarchive& ar) override
+    {
+        if (!modelPayload)
+        {
+            modelPayload = std::make_unique<Payload>();
+        }
+        ar >> *modelPayload;
+    }
+
+    void dropBody() override
+    {
+        modelPayload.reset();
+    }
+
+    size_t residentSize() const override
+    {
+        return ObjectData::residentSize() - sizeof(ObjectData) + sizeof(ModelObjectData)
+            + (isMaterialized() ? sizeof(Payload) : 0);
+    }
+
+private:
+    // empty until lazy loaded object is materialized, so go through payload()
+    std::unique_ptr<Payload> modelPayload;
 };
 
 struct Data final
@@ -43,28 +259,111 @@ struct Data final
     std::vector<std::unique_ptr<ObjectData>> objects;
 
     float duration = 0.0f;
+
+    // Applied to model payloads right after they are read, set it before save when payloads
+    // are not in native layout, e.g. exported on big endian machine. Always None after load
+    PayloadTransform payloadTransform = PayloadTransform::None;
 };
 
+// version 1 stores payload digest after objects
+// version 2 stores payload transform before digest
+BOOST_CLASS_VERSION(Data, 2)
+
+// Memory held by data, for live resource reports
+size_t resourceSize(const Data& data);
+
+// Checksum of all model payloads, in objects order
+uint32_t payloadDigest(const Data& data);
+
+// One pass over all objects: checksums payloads as they are, then applies transform.
+// Returns checksum of not transformed payloads.
+uint32_t processPayloads(Data& data, PayloadTransform transform);
+
+// Lazy format: size of table of contents, then duration and table of contents which are read upfront,
+// object bodies are read on first materialize().
+// Objects loaded from file keep their bodies when saveLazy writes over it, other writers are not tracked
+bool saveLazy(const std::string& path, const Data& data);
+
+bool loadLazy(const std::string& path, Data& data);
+
+// loadLazy split in io part and cpu part: first reads table of contents, second parses it and opens bodies.
+// Contents are opaque, table of contents is read again when file was saved over in between.
+// Data pointer is not used, it is there for LazyFstreamFactory to find this function
+bool readLazyTableOfContents(const std::string& path, std::string& contents, const Data* = nullptr);
+
+bool loadLazyTableOfContents(const std::string& path, const std::string& contents, Data& data);
+
 namespace boost {namespace serialization
 {
 template <typename Archive>
 void serialize(Archive& ar, ObjectData& data, const uint32_t version)
 {
+    // derived parts go after base, so whole object is ready for them
+    data.materialize();
     ar & data.name;
 }
 
+template <typename Archive>
+void serialize(Archive& ar, ObjectHeader& header, const uint32_t version)
+{
+    ar & header.type;
+    ar & header.name;
+    ar & header.offset;
+    ar & header.size;
+    ar & header.digest;
+}
+
 template <typename Archive>
 void serialize(Archive& ar, ModelObjectData& data, const uint32_t version)
 {
     // serialize base class information
     ar & serialization::base_object<ObjectData>(data);
-    ar & data.modelPayload;
+    ar & data.mutablePayload();
+}
+
+template <typename Archive>
+void save(Archive& ar, const Data& data, const uint32_t version)
+{
+    ar << data.objects;
+    ar << data.duration;
+    const auto transform = static_cast<uint32_t>(data.payloadTransform);
+    ar << transform;
+    const auto digest = payloadDigest(data);
+    ar << digest;
+}
+
+template <typename Archive>
+void load(Archive& ar, Data& data, const uint32_t version)
+{
+    ar >> data.objects;
+    ar >> data.duration;
+    auto transform = PayloadTransform::None;
+    if (version > 1)
+    {
+        auto stored = uint32_t {};
+        ar >> stored;
+        if (stored > static_cast<uint32_t>(PayloadTransform::ByteSwap32))
+        {
+            throw std::runtime_error("unknown payload transform");
+        }
+        transform = static_cast<PayloadTransform>(stored);
+    }
+    if (version > 0)
+    {
+        auto stored = uint32_t {};
+        ar >> stored;
+        // digest is of payloads as stored, so check and transform go in one pass
+        if (stored != processPayloads(data, transform))
+        {
+            throw std::runtime_error("payload digest mismatch");
+        }
+    }
+    data.payloadTransform = PayloadTransform::None;
 }
 
 template <typename Archive>
 void serialize(Archive& ar, Data& data, const uint32_t version)
 {
-    ar & data.objects;
-    ar & data.duration;
+    split_free(ar, data, version);
 }
 }}
@@ -1,4 +1,7 @@
 #pragma once
 #include <boost/serialization/export.hpp>
+#include <boost/serialization/factory.hpp>
 struct ModelObjectData;
+// lazy loading constructs objects by export key
+BOOST_SERIALIZATION_FACTORY_0(ModelObjectData)
 BOOST_CLASS_EXPORT(ModelObjectData)